@@ -3,6 +3,7 @@
 
 #include "pin.H"
 #include <iostream>
+#include <functional>
 
 using namespace std;
 
@@ -82,6 +83,102 @@ class Backtrace
         pair<string,INT32> trace[maxDepth];
 };
 
+// A CallSite is a Backtrace that only records raw return addresses, deferring
+// the costly symbolization until the site is printed
+//
+class CallSite
+{
+    public:
+        CallSite()
+        {
+            for (INT32 i = 0; i < maxDepth; i++)
+            {
+                ips[i] = 0;
+            }
+        }
+
+        VOID SetTrace(CONTEXT *ctxt)
+        {
+            VOID *buf[maxDepth + 1];
+            INT32 depth;
+
+            if (ctxt == nullptr)
+            {
+                return;
+            }
+
+            PIN_LockClient();
+            depth = PIN_Backtrace(ctxt, buf, maxDepth + 1) - 1;
+            PIN_UnlockClient();
+
+            // We set i = 1 because we don't want to include the stack frame
+            // for malloc/free
+            //
+            for (INT32 i = 1; i < maxDepth + 1; i++)
+            {
+                ips[i - 1] = (i < depth + 1) ? (ADDRINT) buf[i] : 0;
+            }
+        }
+
+        const ADDRINT *GetTrace() const { return ips; }
+
+        bool operator==(const CallSite &c) const
+        {
+            for (INT32 i = 0; i < maxDepth; i++)
+            {
+                if (ips[i] != c.ips[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        ADDRINT ips[maxDepth];
+};
+
+struct CallSiteHash
+{
+    size_t operator()(const CallSite &c) const
+    {
+        const ADDRINT *ips = c.GetTrace();
+        size_t h = 0;
+        for (INT32 i = 0; i < maxDepth; i++)
+        {
+            h = h * 31 + std::hash<ADDRINT>()(ips[i]);
+        }
+        return h;
+    }
+};
+
+// Symbolizes every return address of a CallSite, falling back to the raw
+// address when no source location is available
+//
+ostream& operator<<(ostream& os, const CallSite& c)
+{
+    const ADDRINT *ips = c.GetTrace();
+    std::string fileName;
+    INT32 lineNumber;
+
+    for (int i = 0; i < maxDepth; i++) {
+        if (ips[i] == 0) {
+            os << "\t\t(NIL)" << std::endl;
+            continue;
+        }
+        lineNumber = 0;
+        PIN_LockClient();
+        PIN_GetSourceLocation(ips[i], nullptr, &lineNumber, &fileName);
+        PIN_UnlockClient();
+        if (lineNumber == 0) {
+            os << "\t\t" << std::hex << ips[i] << std::dec << std::endl;
+        } else {
+            os << "\t\t" << fileName << ":" << lineNumber << std::endl;
+        }
+    }
+    return os;
+}
+
 ostream& operator<<(ostream& os, Backtrace& bt)
 {
     pair<string,INT32> *t;
@@ -0,0 +1,302 @@
+#if !defined(__HEAP_PROFILE_HPP)
+# define __HEAP_PROFILE_HPP
+
+#include "pin.H"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include "backtrace.hpp"
+
+// Power-of-two histogram where bucket i holds values in [2^i, 2^(i+1)),
+// with 0 folded into the first bucket
+//
+class Histogram {
+    public:
+        static const UINT32 numBuckets = 48;
+
+        Histogram() {
+            for (UINT32 i = 0; i < numBuckets; i++) {
+                _buckets[i] = 0;
+            }
+        }
+
+        VOID Add(UINT64 value) {
+            UINT32 i = 0;
+            while (value > 1 && i < numBuckets - 1) {
+                value >>= 1;
+                i++;
+            }
+            _buckets[i]++;
+        }
+
+        VOID Merge(const Histogram &h) {
+            for (UINT32 i = 0; i < numBuckets; i++) {
+                _buckets[i] += h._buckets[i];
+            }
+        }
+
+        UINT64 Total() const {
+            UINT64 total = 0;
+            for (UINT32 i = 0; i < numBuckets; i++) {
+                total += _buckets[i];
+            }
+            return total;
+        }
+
+        VOID Print(std::ostream &os, const std::string &indent) const {
+            for (UINT32 i = 0; i < numBuckets; i++) {
+                if (_buckets[i] == 0) {
+                    continue;
+                }
+                os << indent << "[" << (i == 0 ? 0 : (1ULL << i)) << ", " << (1ULL << (i + 1)) << "): "
+                    << _buckets[i] << std::endl;
+            }
+        }
+
+    private:
+        UINT64 _buckets[numBuckets];
+};
+
+// Statistics for a single allocation site. Lifetimes are measured in
+// allocations, i.e. the number of mallocs that happened while the object was live
+//
+struct SiteStats {
+    SiteStats() : _allocs(0), _frees(0), _bytes(0), _freedBytes(0) { }
+
+    VOID Merge(const SiteStats &s) {
+        _allocs += s._allocs;
+        _frees += s._frees;
+        _bytes += s._bytes;
+        _freedBytes += s._freedBytes;
+        _lifetimes.Merge(s._lifetimes);
+    }
+
+    UINT64 _allocs, _frees;
+    UINT64 _bytes, _freedBytes;
+    Histogram _lifetimes;
+};
+
+// Nothing within ThreadProfile is thread-safe since it is only ever
+// updated by the thread that owns it
+//
+struct ThreadProfile {
+    unordered_map<CallSite,UINT32,CallSiteHash> _siteIds; // Cache of the global site ids this thread has seen
+    unordered_map<UINT32,SiteStats> _sites;
+    Histogram _reuseDistances;
+};
+
+// All of HeapProfiler's methods are thread-safe unless specified otherwise
+//
+class HeapProfiler {
+    public:
+        HeapProfiler() : _clock(0) {
+            for (UINT32 i = 0; i < numShards; i++) {
+                PIN_InitLock(&(_shards[i]._lock));
+            }
+            PIN_InitLock(&_siteLock);
+        }
+
+        // ThreadProfiles are owned by the HeapProfiler and outlive their threads
+        // so that they can all be merged at Fini
+        //
+        ThreadProfile *AddThread(THREADID threadId) {
+            ThreadProfile *p = new ThreadProfile;
+            PIN_GetLock(&_siteLock, threadId);
+            _threads.push_back(p);
+            PIN_ReleaseLock(&_siteLock);
+            return p;
+        }
+
+        VOID RecordMalloc(ThreadProfile *p, ADDRINT ptr, UINT64 size, const CallSite &site, THREADID threadId) {
+            unordered_map<ADDRINT,UINT64>::iterator freedIt;
+            Shard &shard = GetShard(ptr);
+            UINT32 siteId;
+            UINT64 now;
+            UINT64 reuseDistance = 0;
+            BOOL isReuse = false;
+            SiteStats *s;
+
+            siteId = GetSiteId(p, site, threadId);
+
+            PIN_GetLock(&(shard._lock), threadId);
+            now = ++_clock;
+
+            // If this address was freed before, record how many allocations
+            // happened before the allocator handed it out again
+            //
+            freedIt = shard._freedAt.find(ptr);
+            if (freedIt != shard._freedAt.end()) {
+                reuseDistance = Elapsed(freedIt->second, now);
+                isReuse = true;
+                shard._freedAt.erase(freedIt);
+            }
+            shard._live[ptr] = LiveObject(siteId, size, now);
+            PIN_ReleaseLock(&(shard._lock));
+
+            s = &(p->_sites[siteId]);
+            s->_allocs++;
+            s->_bytes += size;
+            if (isReuse) {
+                p->_reuseDistances.Add(reuseDistance);
+            }
+        }
+
+        VOID RecordFree(ThreadProfile *p, ADDRINT ptr, THREADID threadId) {
+            unordered_map<ADDRINT,LiveObject>::iterator it;
+            Shard &shard = GetShard(ptr);
+            LiveObject obj;
+            UINT64 now;
+            UINT64 lifetime;
+            SiteStats *s;
+
+            // Determine if this is an invalid/double free, and if it is, then
+            // skip this routine
+            //
+            PIN_GetLock(&(shard._lock), threadId);
+            it = shard._live.find(ptr);
+            if (it == shard._live.end()) {
+                PIN_ReleaseLock(&(shard._lock));
+                return;
+            }
+            obj = it->second;
+            now = _clock.load();
+            lifetime = Elapsed(obj._allocTime, now);
+            shard._live.erase(it);
+            shard._freedAt[ptr] = now;
+            PIN_ReleaseLock(&(shard._lock));
+
+            // Frees are attributed to the allocation site, even when they
+            // happen on a different thread than the malloc
+            //
+            s = &(p->_sites[obj._siteId]);
+            s->_frees++;
+            s->_freedBytes += obj._size;
+            s->_lifetimes.Add(lifetime);
+        }
+
+        // NOT THREAD-SAFE, only call once the application has finished
+        //
+        VOID Report(std::ostream &os) {
+            unordered_map<UINT32,SiteStats> merged;
+            unordered_map<UINT32,SiteStats>::iterator it;
+            vector<pair<UINT32,SiteStats> > sorted;
+            Histogram reuseDistances;
+
+            for (size_t i = 0; i < _threads.size(); i++) {
+                for (it = _threads[i]->_sites.begin(); it != _threads[i]->_sites.end(); it++) {
+                    merged[it->first].Merge(it->second);
+                }
+                reuseDistances.Merge(_threads[i]->_reuseDistances);
+            }
+
+            // Sort allocation sites by total bytes allocated, breaking ties by allocation count
+            //
+            sorted.assign(merged.begin(), merged.end());
+            sort(sorted.begin(), sorted.end(),
+                [](const pair<UINT32,SiteStats> &a, const pair<UINT32,SiteStats> &b) {
+                    if (a.second._bytes != b.second._bytes) {
+                        return a.second._bytes > b.second._bytes;
+                    }
+                    return a.second._allocs > b.second._allocs;
+                });
+
+            os << "Heap profile: " << sorted.size() << " allocation site(s), "
+                << _clock.load() << " allocation(s)" << std::endl;
+            for (size_t i = 0; i < sorted.size(); i++) {
+                SiteStats &s = sorted[i].second;
+                os << s._allocs << " allocation(s), " << s._bytes << " byte(s), "
+                    << s._bytes - s._freedBytes << " live byte(s) in " << s._allocs - s._frees
+                    << " object(s) @" << std::endl << _sites[sorted[i].first];
+                if (s._lifetimes.Total() > 0) {
+                    os << "\tLifetimes (in allocations):" << std::endl;
+                    s._lifetimes.Print(os, "\t\t");
+                }
+            }
+
+            os << "Reuse distances (in allocations) for " << reuseDistances.Total()
+                << " recycled address(es):" << std::endl;
+            reuseDistances.Print(os, "\t");
+        }
+
+    private:
+        // Only falls back to the global site table, and its lock, the first
+        // time a thread allocates from a given site
+        //
+        UINT32 GetSiteId(ThreadProfile *p, const CallSite &site, THREADID threadId) {
+            unordered_map<CallSite,UINT32,CallSiteHash>::iterator it;
+            UINT32 siteId;
+
+            it = p->_siteIds.find(site);
+            if (it != p->_siteIds.end()) {
+                return it->second;
+            }
+
+            PIN_GetLock(&_siteLock, threadId);
+            it = _siteIds.find(site);
+            if (it == _siteIds.end()) { // If this is a new allocation site, assign it the next id
+                siteId = _sites.size();
+                _siteIds[site] = siteId;
+                _sites.push_back(site);
+            } else {
+                siteId = it->second;
+            }
+            PIN_ReleaseLock(&_siteLock);
+
+            p->_siteIds[site] = siteId;
+            return siteId;
+        }
+
+        struct LiveObject {
+            LiveObject() : _siteId(0), _size(0), _allocTime(0) { }
+            LiveObject(UINT32 siteId, UINT64 size, UINT64 allocTime) :
+                _siteId(siteId),
+                _size(size),
+                _allocTime(allocTime) { }
+
+            UINT32 _siteId;
+            UINT64 _size;
+            UINT64 _allocTime;
+        };
+
+        // Live and freed objects are sharded by address so that mallocs and
+        // frees on different threads rarely contend on the same lock
+        //
+        struct Shard {
+            unordered_map<ADDRINT,LiveObject> _live;
+            unordered_map<ADDRINT,UINT64> _freedAt;
+            PIN_LOCK _lock;
+        };
+
+        static const UINT32 numShards = 64;
+
+        Shard &GetShard(ADDRINT ptr) {
+            // malloc returns 16-byte aligned addresses, so skip the low bits
+            //
+            return _shards[(ptr >> 4) % numShards];
+        }
+
+        // Threads read _clock under different shard locks, so racing
+        // mallocs and frees can observe it out of order
+        //
+        static UINT64 Elapsed(UINT64 from, UINT64 to) {
+            return (to > from) ? to - from : 0;
+        }
+
+        // _clock counts every malloc seen so far and serves as the time base
+        // for both lifetimes and reuse distances
+        //
+        std::atomic<UINT64> _clock;
+        Shard _shards[numShards];
+
+        // Allocation sites are only symbolized when the report is printed
+        //
+        unordered_map<CallSite,UINT32,CallSiteHash> _siteIds;
+        vector<CallSite> _sites;
+        vector<ThreadProfile*> _threads;
+        PIN_LOCK _siteLock;
+};
+
+#endif // __HEAP_PROFILE_HPP
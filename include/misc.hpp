@@ -19,7 +19,7 @@ VOID GetSource(std::ostringstream &source, const CONTEXT *ctxt) {
     source << fileName << ":" << lineNumber;
 }
 
-std::ostream &PrintUseAfterFree(std::ostream &os, ObjectData *d, THREADID accessingThread, ADDRINT addrAccessed, UINT32 accessSize, std::string &source, PIN_LOCK &outputLock) {
+std::ostream &PrintUseAfterFree(std::ostream &os, ObjectData *d, THREADID accessingThread, ADDRINT addrAccessed, ADDRINT accessSize, std::string &source, PIN_LOCK &outputLock) {
     PIN_GetLock(&outputLock, accessingThread);
     os << "Thread " << accessingThread << " accessed " << accessSize << " byte(s) at address <" << std::hex << 
         d->_addr << std::dec << "+" << addrAccessed - d->_addr << ">" << " in " << source << std::endl <<
@@ -3,13 +3,17 @@
 
 #include "backtrace.hpp"
 
+struct ThreadProfile;
+
 struct MyTLS {
-    MyTLS() : _inMalloc(false) { }
+    MyTLS() : _inMalloc(false), _profile(nullptr) { }
 
     void *_cachedPtr;
     size_t _cachedSize;
     Backtrace _cachedBacktrace;
+    CallSite _cachedSite;
     BOOL _inMalloc;
+    ThreadProfile *_profile;
 };
 
 #endif // __MY_TLS_HPP
@@ -6,6 +6,13 @@
 #include "backtrace.hpp"
 
 struct ObjectData {
+    ObjectData() :
+        _addr(0),
+        _size(0),
+        _isLive(false),
+        _mallocThread(-1),
+        _freeThread(-1) { }
+
     ObjectData(ADDRINT addr, UINT32 size, THREADID mallocThread, Backtrace mallocTrace) : 
         _addr(addr),
         _size(size),
@@ -3,7 +3,8 @@
 
 #include "pin.H"
 #include "backtrace.hpp"
-#include <unordered_map>
+#include <map>
+#include <iterator>
 
 using namespace std;
 
@@ -16,86 +17,180 @@ class ObjectManager {
         }
 
         VOID InsertObject(ADDRINT ptr, UINT32 size, Backtrace trace, THREADID threadId) {
-            unordered_map<ADDRINT,ObjectData*>::iterator it;
-            ObjectData *d;
-            ADDRINT nextAddr;
+            map<ADDRINT,ObjectData*>::iterator it;
+            ObjectData *d = nullptr;
+
+            if (size == 0) {
+                return;
+            }
 
-            // If this object has already been inserted before, delete the
-            // previous object data it mapped to
+            // If an object started at this exact address before, reuse its
+            // ObjectData. Any other objects overlapping this one are evicted,
+            // since the allocator has handed their bytes out again
             //
             PIN_GetLock(&_allObjectsLock, threadId);
             it = _allObjects.find(ptr);
-            if (it != _allObjects.end()) { // If this object is already within _allObjects, change its contents
-                PIN_ReleaseLock(&_allObjectsLock);
+            if (it != _allObjects.end()) {
                 d = it->second;
+                _allObjects.erase(it);
+            }
+            EvictObjects(ptr, size);
+            if (d != nullptr) { // If this object is already within _allObjects, change its contents
                 *d = ObjectData(ptr, size, threadId, trace);
             } else { // If this object is not within _allObjects, allocate a new ObjectData
-                PIN_ReleaseLock(&_allObjectsLock);
                 d = new ObjectData(ptr, size, threadId, trace);
             }
-
-            // Create a mapping from every address in this object's range to the same ObjectData
-            //
-            for (UINT32 i = 0; i < size; i++) {
-                nextAddr = (ptr + i);
-                PIN_GetLock(&_allObjectsLock, threadId);
-                _allObjects[nextAddr] = d;
-                // _allObjects.insert(make_pair<ADDRINT,ObjectData*>(nextAddr, d));
-                PIN_ReleaseLock(&_allObjectsLock);
-            }
+            _allObjects[ptr] = d;
+            PIN_ReleaseLock(&_allObjectsLock);
         }
 
         VOID DeleteObject(ADDRINT ptr, Backtrace trace, THREADID threadId)
         {
-            unordered_map<ADDRINT,ObjectData*>::iterator it;
+            map<ADDRINT,ObjectData*>::iterator it;
             ObjectData *d;
 
-            // Determine if this is an invalid/double free, and if it is, then 
+            // Determine if this is an invalid/double free, and if it is, then
             // skip this routine
             //
             PIN_GetLock(&_allObjectsLock, threadId);
-            it = _allObjects.find(ptr);
-            if (it == _allObjects.end()) {
+            it = _allObjects.upper_bound(ptr);
+            if (it == _allObjects.begin()) {
                 PIN_ReleaseLock(&_allObjectsLock);
                 return;
             }
-            PIN_ReleaseLock(&_allObjectsLock);
-    
+            it--;
+            d = it->second;
+            if (ptr >= it->first + d->_size) {
+                PIN_ReleaseLock(&_allObjectsLock);
+                return;
+            }
+
             // Update object metadata, also marking the object as no longer live
             //
-            d = it->second;
             d->_freeThread = threadId;
             d->_freeTrace = trace;
             d->_isLive = false;
+            PIN_ReleaseLock(&_allObjectsLock);
         }
 
-        ObjectData *IsUseAfterFree(ADDRINT addr, UINT32 size, THREADID threadId) {
-            unordered_map<ADDRINT,ObjectData*>::iterator it;
-            ObjectData *d;
+        // Determine whether [addrs[i], addrs[i] + size) overlaps a freed object for
+        // any i. If it does, copy that object into freed and return the first
+        // freed address and the number of freed bytes in the range
+        //
+        BOOL IsUseAfterFree(const ADDRINT *addrs, UINT32 numAddrs, ADDRINT size, THREADID threadId,
+                            ObjectData &freed, ADDRINT &addrFreed, ADDRINT &sizeFreed) {
+            ObjectData *d = nullptr;
 
-            // Determine whether addr corresponds to an object returned by malloc, 
-            // and if it isn't, then skip this routine
-            //
             PIN_GetLock(&_allObjectsLock, threadId);
-            it = _allObjects.find(addr);
-            if (it == _allObjects.end()) {
-                PIN_ReleaseLock(&_allObjectsLock);
-                return nullptr;
+            for (UINT32 i = 0; i < numAddrs && d == nullptr; i++) {
+                d = FindFreed(addrs[i], size, addrFreed, sizeFreed);
+            }
+            if (d != nullptr) {
+                freed = *d;
             }
             PIN_ReleaseLock(&_allObjectsLock);
+            return d != nullptr;
+        }
 
-            // TODO: Need atomicity for accessing object data?
-            //
-            d = it->second;
-            if (d->_isLive) {
-                return nullptr;
-            } else {
-                return d;
+        // Same as above, but for every active element of a multi-operand access.
+        // The elements of a gather/scatter are first checked with a single query
+        // spanning all of them, and only checked one by one if that finds a
+        // freed object, so that gaps between elements are never flagged
+        //
+        BOOL IsUseAfterFree(const PIN_MULTI_MEM_ACCESS_INFO *info, BOOL isVector, THREADID threadId,
+                            ObjectData &freed, ADDRINT &addrFreed, ADDRINT &sizeFreed) {
+            ObjectData *d = nullptr;
+            ADDRINT lo = 0, hi = 0, addr;
+
+            PIN_GetLock(&_allObjectsLock, threadId);
+            if (isVector) {
+                for (UINT32 i = 0; i < info->numberOfMemops; i++) {
+                    if (!info->memop[i].maskOn) {
+                        continue;
+                    }
+                    addr = info->memop[i].memoryAddress;
+                    if (lo == hi) {
+                        lo = addr;
+                        hi = addr + info->memop[i].bytesAccessed;
+                    } else {
+                        lo = (addr < lo) ? addr : lo;
+                        hi = (addr + info->memop[i].bytesAccessed > hi) ? addr + info->memop[i].bytesAccessed : hi;
+                    }
+                }
+                if (FindFreed(lo, hi - lo, addrFreed, sizeFreed) == nullptr) {
+                    PIN_ReleaseLock(&_allObjectsLock);
+                    return false;
+                }
+            }
+
+            for (UINT32 i = 0; i < info->numberOfMemops && d == nullptr; i++) {
+                if (!info->memop[i].maskOn) { // Masked off elements of gathers/scatters are never accessed
+                    continue;
+                }
+                d = FindFreed(info->memop[i].memoryAddress, info->memop[i].bytesAccessed, addrFreed, sizeFreed);
+            }
+            if (d != nullptr) {
+                freed = *d;
             }
+            PIN_ReleaseLock(&_allObjectsLock);
+            return d != nullptr;
         }
 
     private:
-        unordered_map<ADDRINT,ObjectData*> _allObjects;
+        // Remove and free every object overlapping [ptr, ptr + size), which
+        // keeps the intervals within _allObjects disjoint
+        // NOT THREAD-SAFE, _allObjectsLock must be held
+        //
+        VOID EvictObjects(ADDRINT ptr, ADDRINT size) {
+            map<ADDRINT,ObjectData*>::iterator it, prev;
+
+            it = _allObjects.lower_bound(ptr + size);
+            while (it != _allObjects.begin()) {
+                prev = std::prev(it);
+                if (prev->first + prev->second->_size <= ptr) {
+                    break;
+                }
+                delete prev->second;
+                _allObjects.erase(prev);
+            }
+        }
+
+        // Query _allObjects for the lowest freed address in [addr, addr + size),
+        // along with how many bytes of the range that freed object covers.
+        // Bytes that fall outside every object are never flagged
+        // NOT THREAD-SAFE, _allObjectsLock must be held
+        //
+        ObjectData *FindFreed(ADDRINT addr, ADDRINT size, ADDRINT &addrFreed, ADDRINT &sizeFreed) {
+            map<ADDRINT,ObjectData*>::iterator it;
+            ObjectData *d = nullptr;
+            ADDRINT end;
+
+            if (size == 0) {
+                return nullptr;
+            }
+
+            // Since intervals are disjoint, walk back from the last object starting
+            // within the range until reaching one that ends before addr
+            //
+            it = _allObjects.upper_bound(addr + size - 1);
+            while (it != _allObjects.begin()) {
+                it--;
+                end = it->first + it->second->_size;
+                if (end <= addr) {
+                    break;
+                }
+                if (!it->second->_isLive) {
+                    d = it->second;
+                    addrFreed = (it->first > addr) ? it->first : addr;
+                    sizeFreed = ((end < addr + size) ? end : addr + size) - addrFreed;
+                }
+            }
+            return d;
+        }
+
+        // Objects keyed by their first address. No two objects overlap
+        //
+        map<ADDRINT,ObjectData*> _allObjects;
         PIN_LOCK _allObjectsLock;
 };
 
@@ -10,6 +10,7 @@
 #include "objectdata.hpp"
 #include "backtrace.hpp"
 #include "objectmanager.hpp"
+#include "heapprofile.hpp"
 #include "mytls.hpp"
 #include "misc.hpp"
 
@@ -32,12 +33,15 @@
 using namespace std;
 
 static ObjectManager manager;
+static HeapProfiler profiler;
 static TLS_KEY tls_key = INVALID_TLS_KEY; // Thread Local Storage
 static PIN_LOCK outputLock;
 static std::unordered_map<std::string, UINT32> accessData;
+static const ADDRINT directionFlag = 0x400; // DF bit within the flags register
 
 namespace DefaultParams {
     static const std::string defaultIsVerbose = "0",
+        defaultIsProfiling = "0",
         defaultMallocName = MALLOC, 
         defaultFreeName = FREE,
         defaultTraceFile = "dangling.out";
@@ -45,6 +49,7 @@ namespace DefaultParams {
 
 namespace Params {
     static BOOL isVerbose;
+    static BOOL isProfiling;
     static std::string mallocName;
     static std::string freeName;
     static std::ofstream traceFile;
@@ -52,6 +57,9 @@ namespace Params {
 
 VOID ThreadStart(THREADID threadId, CONTEXT *ctxt, INT32 flags, VOID* v) {
     MyTLS *tls = new MyTLS;
+    if (Params::isProfiling) {
+        tls->_profile = profiler.AddThread(threadId);
+    }
     assert(PIN_SetThreadData(tls_key, tls, threadId));
 }
 
@@ -66,7 +74,13 @@ VOID ThreadFini(THREADID threadId, const CONTEXT *ctxt, INT32 code, VOID* v) {
 VOID MallocBefore(THREADID threadId, CONTEXT *ctxt, ADDRINT size) {
     MyTLS *tls = static_cast<MyTLS*>(PIN_GetThreadData(tls_key, threadId));
     tls->_cachedSize = size;
-    tls->_cachedBacktrace.SetTrace(ctxt);
+    // Profiling only needs raw return addresses to tell allocation sites apart
+    //
+    if (Params::isProfiling) {
+        tls->_cachedSite.SetTrace(ctxt);
+    } else {
+        tls->_cachedBacktrace.SetTrace(ctxt);
+    }
     tls->_inMalloc = true;
 }
 
@@ -78,14 +92,22 @@ VOID MallocAfter(THREADID threadId, ADDRINT retVal) {
     }
 
     MyTLS *tls = static_cast<MyTLS*>(PIN_GetThreadData(tls_key, threadId));
-    manager.InsertObject(retVal, tls->_cachedSize, tls->_cachedBacktrace, threadId);
+    if (Params::isProfiling) {
+        profiler.RecordMalloc(tls->_profile, retVal, tls->_cachedSize, tls->_cachedSite, threadId);
+    } else {
+        manager.InsertObject(retVal, tls->_cachedSize, tls->_cachedBacktrace, threadId);
+    }
     tls->_inMalloc = false;
 }
 
 VOID FreeBefore(THREADID threadId, CONTEXT *ctxt, ADDRINT ptr) {
     MyTLS *tls = static_cast<MyTLS*>(PIN_GetThreadData(tls_key, threadId));
     tls->_cachedPtr = (void *) ptr;
-    tls->_cachedBacktrace.SetTrace(ctxt);
+    // Profiling never reports where objects were freed, so skip the costly backtrace
+    //
+    if (!Params::isProfiling) {
+        tls->_cachedBacktrace.SetTrace(ctxt);
+    }
 }
 
 // We must separate FreeBefore and FreeAfter to avoid considering any metadata
@@ -93,21 +115,17 @@ VOID FreeBefore(THREADID threadId, CONTEXT *ctxt, ADDRINT ptr) {
 //
 VOID FreeAfter(THREADID threadId) {
     MyTLS *tls = static_cast<MyTLS*>(PIN_GetThreadData(tls_key, threadId));
-    manager.DeleteObject((ADDRINT) tls->_cachedPtr, tls->_cachedBacktrace, threadId);
+    if (Params::isProfiling) {
+        profiler.RecordFree(tls->_profile, (ADDRINT) tls->_cachedPtr, threadId);
+    } else {
+        manager.DeleteObject((ADDRINT) tls->_cachedPtr, tls->_cachedBacktrace, threadId);
+    }
 }
 
-VOID MemAccess(THREADID threadId, ADDRINT addrAccessed, UINT32 accessSize, const CONTEXT *ctxt) {
-    MyTLS *tls = static_cast<MyTLS*>(PIN_GetThreadData(tls_key, threadId));
-    ObjectData *d = manager.IsUseAfterFree(addrAccessed, accessSize, threadId);
+VOID ReportUseAfterFree(THREADID threadId, ObjectData *d, ADDRINT addrAccessed, ADDRINT accessSize, const CONTEXT *ctxt) {
     std::ostringstream sourceStream;
     std::string source;
 
-    if (UNLIKELY(tls->_inMalloc)) { // If this is a read during malloc
-        return;
-    }
-    if (LIKELY(!d)) { // If this is a valid read
-        return;
-    }
     // PrintUseAfterFree(d, threadId, addrAccessed, accessSize, ctxt);
     // TODO: concurrency?
     GetSource(sourceStream, ctxt);
@@ -122,28 +140,113 @@ VOID MemAccess(THREADID threadId, ADDRINT addrAccessed, UINT32 accessSize, const
     }
 }
 
+// Checks every memory operand of an instruction, including both operands
+// of two-operand instructions and every element of gathers/scatters
+//
+VOID MemAccess(THREADID threadId, PIN_MULTI_MEM_ACCESS_INFO *info, BOOL isVector, const CONTEXT *ctxt) {
+    MyTLS *tls = static_cast<MyTLS*>(PIN_GetThreadData(tls_key, threadId));
+    ObjectData d;
+    ADDRINT addrFreed, sizeFreed;
+
+    if (UNLIKELY(tls->_inMalloc)) { // If this is an access during malloc
+        return;
+    }
+    if (LIKELY(!manager.IsUseAfterFree(info, isVector, threadId, d, addrFreed, sizeFreed))) { // If this is a valid access
+        return;
+    }
+    ReportUseAfterFree(threadId, &d, addrFreed, sizeFreed, ctxt);
+}
+
+ADDRINT IsFirstRepIteration(BOOL firstRep) {
+    return firstRep;
+}
+
+// Checks the entire ranges touched by both memory operands of a rep movs
+// (or the single operand of a rep stos) at once, rather than once per iteration
+//
+VOID RepMemAccess(THREADID threadId, ADDRINT firstAddr, ADDRINT secondAddr, UINT32 numOperands,
+                    UINT32 elementSize, ADDRINT count, ADDRINT flags, const CONTEXT *ctxt) {
+    MyTLS *tls = static_cast<MyTLS*>(PIN_GetThreadData(tls_key, threadId));
+    ObjectData d;
+    ADDRINT addrs[2] = { firstAddr, secondAddr };
+    ADDRINT addrFreed, sizeFreed;
+
+    if (UNLIKELY(tls->_inMalloc)) { // If this is an access during malloc
+        return;
+    }
+
+    // If the direction flag is set, the string operation walks down from each address
+    //
+    if (flags & directionFlag) {
+        for (UINT32 i = 0; i < numOperands; i++) {
+            addrs[i] -= (count - 1) * elementSize;
+        }
+    }
+    if (LIKELY(!manager.IsUseAfterFree(addrs, numOperands, count * elementSize, threadId, d, addrFreed, sizeFreed))) { // If this is a valid access
+        return;
+    }
+    // Report every freed byte the range overlaps rather than a single element
+    //
+    ReportUseAfterFree(threadId, &d, addrFreed, sizeFreed, ctxt);
+}
+
+// Only movs and stos are guaranteed to run for the full count, whereas
+// cmps and scas may stop early, so those are still checked per iteration
+//
+BOOL IsRepMovsOrStos(INS ins) {
+    switch (INS_Opcode(ins)) {
+        case XED_ICLASS_REP_MOVSB:
+        case XED_ICLASS_REP_MOVSW:
+        case XED_ICLASS_REP_MOVSD:
+        case XED_ICLASS_REP_MOVSQ:
+        case XED_ICLASS_REP_STOSB:
+        case XED_ICLASS_REP_STOSW:
+        case XED_ICLASS_REP_STOSD:
+        case XED_ICLASS_REP_STOSQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
 VOID Instruction(INS ins, VOID *v) {
-    if (INS_IsMemoryRead(ins) && !INS_IsStackRead(ins)) {
-        // Intercept read instructions that don't read from the stack with MemAccess
+    if (!(INS_IsMemoryRead(ins) && !INS_IsStackRead(ins)) &&
+            !(INS_IsMemoryWrite(ins) && !INS_IsStackWrite(ins))) {
+        // Skip instructions that only access the stack
         //
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) MemAccess,
-                        IARG_THREAD_ID,
-                        IARG_MEMORYREAD_EA,
-                        IARG_MEMORYREAD_SIZE,
-                        IARG_CONST_CONTEXT,
-                        IARG_END);
+        return;
     }
 
-    if (INS_IsMemoryWrite(ins) && !INS_IsStackWrite(ins)) {
-        // Intercept write instructions that don't write to the stack with MemAccess
+    if (IsRepMovsOrStos(ins)) {
+        // Intercept only the first iteration of rep movs/stos with RepMemAccess,
+        // passing every memory operand to a single call. Predicated calls are
+        // skipped when the count is zero
         //
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) MemAccess,
+        UINT32 numOperands = INS_MemoryOperandCount(ins);
+        INS_InsertIfPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) IsFirstRepIteration,
+                        IARG_FIRST_REP_ITERATION,
+                        IARG_END);
+        INS_InsertThenPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) RepMemAccess,
                         IARG_THREAD_ID,
-                        IARG_MEMORYWRITE_EA,
-                        IARG_MEMORYWRITE_SIZE,
+                        IARG_MEMORYOP_EA, 0,
+                        IARG_MEMORYOP_EA, numOperands - 1,
+                        IARG_UINT32, numOperands,
+                        IARG_UINT32, INS_MemoryOperandSize(ins, 0),
+                        IARG_REG_VALUE, INS_RepCountRegister(ins),
+                        IARG_REG_VALUE, REG_GFLAGS,
                         IARG_CONST_CONTEXT,
                         IARG_END);
+        return;
     }
+
+    // Intercept all other instructions that access memory with MemAccess
+    //
+    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) MemAccess,
+                    IARG_THREAD_ID,
+                    IARG_MULTI_MEMORYACCESS_EA,
+                    IARG_BOOL, INS_IsVgather(ins) || INS_IsVscatter(ins),
+                    IARG_CONST_CONTEXT,
+                    IARG_END);
 }
 
 VOID Image(IMG img, VOID *v) {
@@ -184,7 +287,9 @@ VOID Image(IMG img, VOID *v) {
 }
 
 VOID Fini(INT32 code, VOID *v) {
-    if (!Params::isVerbose) {
+    if (Params::isProfiling) {
+        profiler.Report(Params::traceFile);
+    } else if (!Params::isVerbose) {
         for (auto it = accessData.begin(); it != accessData.end(); it++) {
             Params::traceFile << it->second << " use after frees at " << it->first << std::endl;
         }
@@ -199,6 +304,9 @@ int main(int argc, char *argv[]) {
     KNOB<UINT32> knobIsVerbose(KNOB_MODE_WRITEONCE, "pintool", "v", 
                             DefaultParams::defaultIsVerbose,
                             "Dispay additional information including backtraces");
+    KNOB<UINT32> knobIsProfiling(KNOB_MODE_WRITEONCE, "pintool", "p",
+                            DefaultParams::defaultIsProfiling,
+                            "Profile allocation sites instead of checking for dangling pointers");
     KNOB<std::string> knobMallocName(KNOB_MODE_WRITEONCE, "pintool", "m", 
                             DefaultParams::defaultMallocName,
                             "Name of malloc routine");
@@ -215,6 +323,7 @@ int main(int argc, char *argv[]) {
     }
 
     Params::isVerbose = knobIsVerbose.Value();
+    Params::isProfiling = knobIsProfiling.Value();
     Params::mallocName = knobMallocName.Value();
     Params::freeName = knobFreeName.Value();
     Params::traceFile.open(knobTraceFile.Value().c_str());
@@ -228,7 +337,12 @@ int main(int argc, char *argv[]) {
     }
 
     IMG_AddInstrumentFunction(Image, 0);
-    INS_AddInstrumentFunction(Instruction, 0);
+    // Profiling only needs the malloc/free hooks, so skip instrumenting
+    // memory accesses altogether to keep long captures cheap
+    //
+    if (!Params::isProfiling) {
+        INS_AddInstrumentFunction(Instruction, 0);
+    }
     PIN_AddThreadStartFunction(ThreadStart, 0);
     PIN_AddThreadFiniFunction(ThreadFini, 0);
 	PIN_AddFiniFunction(Fini, 0);
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <cstdlib>
+#include <cassert>
+#include <utility>
+// The gather test is only built by the rep_avx2 target, which requires AVX2
+//
+#if defined(__AVX2__)
+# include <immintrin.h>
+#endif // __AVX2__
+
+void rep_stos(void *s, int c, size_t n) {
+    asm volatile("rep stosb" : "+D"(s), "+c"(n) : "a"(c) : "memory");
+}
+
+void rep_movs(void *dst, const void *src, size_t n) {
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+
+// Copies n bytes starting from the last byte of each buffer, walking down
+//
+void rep_movs_backward(void *dst, const void *src, size_t n) {
+    dst = (char *) dst + n - 1;
+    src = (const char *) src + n - 1;
+    asm volatile("std\n\trep movsb\n\tcld" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+
+void movs(void *dst, const void *src) {
+    asm volatile("movsb" : "+D"(dst), "+S"(src) : : "memory");
+}
+
+void cmps(const void *s1, const void *s2) {
+    asm volatile("cmpsb" : "+S"(s1), "+D"(s2) : : "cc", "memory");
+}
+
+void repe_cmps(const void *s1, const void *s2, size_t n) {
+    asm volatile("repe cmpsb" : "+S"(s1), "+D"(s2), "+c"(n) : : "cc", "memory");
+}
+
+void repne_scas(const void *s, int c, size_t n) {
+    asm volatile("repne scasb" : "+D"(s), "+c"(n) : "a"(c) : "cc", "memory");
+}
+
+int main() {
+    const unsigned int SIZE = 4096;
+    char *src = (char *) malloc(SIZE);
+    char *dst = (char *) malloc(SIZE);
+    char *live = (char *) malloc(SIZE);
+    char *partial = (char *) malloc(SIZE);
+    assert(src != nullptr && dst != nullptr && live != nullptr && partial != nullptr);
+
+    // Make sure the freed buffer lies after the live one, so that a copy
+    // starting in live reaches into partial partway through
+    //
+    if (partial < live) {
+        std::swap(partial, live);
+    }
+    const size_t span = partial + SIZE - live;
+    assert(span <= 4 * SIZE);
+    char *scratch = (char *) malloc(span);
+    assert(scratch != nullptr);
+
+    std::cout << "APPLICATION: BEGINNING VALID STRING OPERATIONS" << std::endl;
+    rep_stos(src, 'a', SIZE);
+    rep_movs(dst, src, SIZE);
+    rep_movs_backward(dst, src, SIZE);
+    movs(dst, src);
+    cmps(src, dst);
+    repe_cmps(src, dst, SIZE);
+    repne_scas(src, 'b', SIZE);
+    std::cout << "APPLICATION: ENDING VALID STRING OPERATIONS" << std::endl;
+
+    free(src);
+    free(partial);
+
+    std::cout << "APPLICATION: BEGINNING INVALID REP READS" << std::endl;
+    rep_movs(dst, src, SIZE);
+    std::cout << "APPLICATION: ENDING INVALID REP READS" << std::endl;
+
+    std::cout << "APPLICATION: BEGINNING INVALID BACKWARD REP READS" << std::endl;
+    rep_movs_backward(dst, src, SIZE);
+    std::cout << "APPLICATION: ENDING INVALID BACKWARD REP READS" << std::endl;
+
+    std::cout << "APPLICATION: BEGINNING INVALID PARTIAL REP READS" << std::endl;
+    rep_movs(scratch, live, span);
+    std::cout << "APPLICATION: ENDING INVALID PARTIAL REP READS" << std::endl;
+
+    std::cout << "APPLICATION: BEGINNING INVALID SECOND OPERAND READS" << std::endl;
+    movs(dst, src);
+    cmps(live, src);
+    std::cout << "APPLICATION: ENDING INVALID SECOND OPERAND READS" << std::endl;
+
+    std::cout << "APPLICATION: BEGINNING INVALID PER ITERATION REP READS" << std::endl;
+    repe_cmps(dst, src, SIZE);
+    repne_scas(src, 'b', SIZE);
+    std::cout << "APPLICATION: ENDING INVALID PER ITERATION REP READS" << std::endl;
+
+#if defined(__AVX2__)
+    std::cout << "APPLICATION: BEGINNING INVALID GATHER READS" << std::endl;
+    __m256i indices = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+    volatile __m256i gathered = _mm256_i32gather_epi32((const int *) src, indices, 4);
+    (void) gathered;
+    std::cout << "APPLICATION: ENDING INVALID GATHER READS" << std::endl;
+#endif // __AVX2__
+
+    free(scratch);
+    free(live);
+    free(dst);
+
+    std::cout << "APPLICATION: BEGINNING INVALID WRITES" << std::endl;
+    rep_stos(dst, 'a', SIZE);
+    std::cout << "APPLICATION: ENDING INVALID WRITES" << std::endl;
+
+    return 0;
+}